@@ -13,6 +13,12 @@
 #include <algorithm>
 #include <iomanip>
 #include <ctime>
+#include <functional>
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+#include <string_view>
+#include <charconv>
 
 #ifdef _WIN32
     #include <winsock2.h>
@@ -22,6 +28,8 @@
     #define INVALID_SOCKET_VAL INVALID_SOCKET
     #define SOCKET_ERROR_VAL SOCKET_ERROR
     #define close_socket closesocket
+    #define SHUTDOWN_BOTH_VAL SD_BOTH
+    #define SEND_FLAGS_VAL 0
 #else
     #include <sys/socket.h>
     #include <netinet/in.h>
@@ -32,6 +40,13 @@
     #define INVALID_SOCKET_VAL -1
     #define SOCKET_ERROR_VAL -1
     #define close_socket close
+    #define SHUTDOWN_BOTH_VAL SHUT_RDWR
+    // A peer that resets mid-write should fail the send, not raise SIGPIPE
+    #ifdef MSG_NOSIGNAL
+        #define SEND_FLAGS_VAL MSG_NOSIGNAL
+    #else
+        #define SEND_FLAGS_VAL 0
+    #endif
 #endif
 
 // Simple RSA implementation for demonstration (not cryptographically secure)
@@ -94,33 +109,134 @@ public:
     }
 };
 
-// Simple AES-like encryption for session keys
-class SimpleCipher {
+// Byte-oriented LZ77 codec for chat text. A token below 0x80 introduces
+// (token + 1) literal bytes; any other token is a match of (token - 0x80 + 4)
+// bytes copied from a 16-bit little-endian distance back. Both sides prime the
+// window with the same dictionary so short messages still find matches.
+class LZCodec {
 private:
-    std::string key;
+    static constexpr size_t MIN_MATCH = 4;
+    static constexpr size_t MAX_MATCH = 0x7F + MIN_MATCH;
+    static constexpr size_t MAX_LITERALS = 0x80;
+    static constexpr size_t MAX_DISTANCE = 0xFFFF;
+    static constexpr int HASH_BITS = 12;
+    
+    static uint32_t hashAt(const std::string& window, size_t pos) {
+        uint32_t v;
+        std::memcpy(&v, window.data() + pos, sizeof(v));
+        return (v * 2654435761u) >> (32 - HASH_BITS);
+    }
+    
+    static void appendLiterals(std::string& out, const std::string& window, size_t from, size_t to) {
+        while (from < to) {
+            size_t count = std::min(MAX_LITERALS, to - from);
+            out += static_cast<char>(count - 1);
+            out.append(window, from, count);
+            from += count;
+        }
+    }
     
 public:
-    SimpleCipher(const std::string& k) : key(k) {}
+    // Largest payload a compressed frame may expand to
+    static constexpr size_t MAX_RAW_LENGTH = 1 << 24;
     
-    std::string encrypt(const std::string& plaintext) {
-        std::string encrypted = plaintext;
-        for (size_t i = 0; i < encrypted.length(); i++) {
-            encrypted[i] ^= key[i % key.length()];
-            encrypted[i] = ((encrypted[i] + 13) % 256);
+    // Dictionary text plus its primed hash heads; built once per room and
+    // copied into each compress() call instead of re-hashing the dictionary
+    struct Dictionary {
+        std::string text;
+        std::vector<int32_t> head;
+    };
+    
+    static Dictionary prime(const std::string& text) {
+        Dictionary dictionary{text, std::vector<int32_t>(1 << HASH_BITS, -1)};
+        for (size_t p = 0; p + MIN_MATCH <= text.size(); p++) {
+            dictionary.head[hashAt(text, p)] = static_cast<int32_t>(p);
         }
-        return encrypted;
+        return dictionary;
     }
     
-    std::string decrypt(const std::string& ciphertext) {
-        std::string decrypted = ciphertext;
-        for (size_t i = 0; i < decrypted.length(); i++) {
-            decrypted[i] = ((decrypted[i] - 13 + 256) % 256);
-            decrypted[i] ^= key[i % key.length()];
+    static std::string compress(const std::string& input, const Dictionary& dictionary) {
+        std::string window;
+        window.reserve(dictionary.text.size() + input.size());
+        window.append(dictionary.text).append(input);
+        std::vector<int32_t> head(dictionary.head);
+        
+        size_t pos = dictionary.text.size();
+        std::string out;
+        size_t literalStart = pos;
+        while (pos + MIN_MATCH <= window.size()) {
+            uint32_t h = hashAt(window, pos);
+            int32_t candidate = head[h];
+            head[h] = static_cast<int32_t>(pos);
+            
+            if (candidate < 0 || pos - candidate > MAX_DISTANCE ||
+                std::memcmp(window.data() + candidate, window.data() + pos, MIN_MATCH) != 0) {
+                pos++;
+                continue;
+            }
+            
+            size_t length = MIN_MATCH;
+            while (pos + length < window.size() && length < MAX_MATCH &&
+                   window[candidate + length] == window[pos + length]) {
+                length++;
+            }
+            
+            appendLiterals(out, window, literalStart, pos);
+            size_t distance = pos - candidate;
+            out += static_cast<char>(0x80 + length - MIN_MATCH);
+            out += static_cast<char>(distance & 0xFF);
+            out += static_cast<char>(distance >> 8);
+            
+            for (size_t p = pos + 1; p < pos + length && p + MIN_MATCH <= window.size(); p++) {
+                head[hashAt(window, p)] = static_cast<int32_t>(p);
+            }
+            pos += length;
+            literalStart = pos;
         }
-        return decrypted;
+        appendLiterals(out, window, literalStart, window.size());
+        return out;
+    }
+    
+    static bool decompress(const std::string& data, const std::string& dictionary,
+                           size_t rawLength, std::string& output) {
+        if (rawLength > MAX_RAW_LENGTH) return false;
+        
+        std::string window = dictionary;
+        window.reserve(dictionary.size() + rawLength);
+        size_t limit = dictionary.size() + rawLength;
+        
+        size_t i = 0;
+        while (i < data.size()) {
+            unsigned char token = static_cast<unsigned char>(data[i++]);
+            if (token < 0x80) {
+                size_t count = token + 1;
+                if (i + count > data.size() || window.size() + count > limit) return false;
+                window.append(data, i, count);
+                i += count;
+            } else {
+                if (i + 2 > data.size()) return false;
+                size_t length = token - 0x80 + MIN_MATCH;
+                size_t distance = static_cast<unsigned char>(data[i]) |
+                                  (static_cast<unsigned char>(data[i + 1]) << 8);
+                i += 2;
+                if (distance == 0 || distance > window.size() || window.size() + length > limit) return false;
+                // Byte-wise copy so overlapping matches repeat correctly
+                size_t from = window.size() - distance;
+                for (size_t k = 0; k < length; k++) {
+                    window += window[from + k];
+                }
+            }
+        }
+        if (window.size() != limit) return false;
+        
+        output.assign(window, dictionary.size(), std::string::npos);
+        return true;
     }
 };
 
+// Payloads shorter than this are always sent as plain text
+const size_t COMPRESSION_THRESHOLD = 128;
+
 // Message structure
 struct Message {
     std::string sender;
@@ -129,6 +245,229 @@ struct Message {
     bool encrypted;
 };
 
+// Longest line the server buffers while waiting for its '\n'
+const size_t MAX_LINE_LENGTH = 8192;
+
+// Policy-based message pipeline. Transport, framing and cipher are template
+// parameters, so every hop on the per-message path is resolved at compile time
+// and inlines down to plain socket calls and loops.
+struct SocketTransport {
+    static bool write(SOCKET_T sock, const char* data, size_t length) {
+        size_t sent = 0;
+        while (sent < length) {
+            int result = send(sock, data + sent, length - sent, SEND_FLAGS_VAL);
+            if (result <= 0) return false;
+            sent += result;
+        }
+        return true;
+    }
+    
+    static int read(SOCKET_T sock, char* buffer, size_t length) {
+        return recv(sock, buffer, length, 0);
+    }
+};
+
+// Messages are newline-terminated on the wire so several can share one write
+struct LineFraming {
+    static void frame(std::string& out, std::string_view payload) {
+        out.append(payload);
+        out += '\n';
+    }
+    
+    // Moves the next complete line out of a receive buffer, dropping any '\r'
+    static bool next(std::string& pending, std::string& line) {
+        size_t end = pending.find('\n');
+        if (end == std::string::npos) return false;
+        line.assign(pending, 0, end);
+        pending.erase(0, end + 1);
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        return true;
+    }
+};
+
+struct ChatKey {
+    static constexpr char value[] = "CipherChatKey123";
+    static constexpr size_t length = sizeof(value) - 1;
+};
+
+// Simple AES-like encryption for session keys, with the key fixed at compile time
+template <typename Key>
+struct StaticXorCipher {
+    static_assert(Key::length > 0, "cipher key must not be empty");
+    
+    static std::string encrypt(std::string_view plaintext) {
+        std::string encrypted(plaintext);
+        for (size_t i = 0; i < encrypted.length(); i++) {
+            encrypted[i] ^= Key::value[i % Key::length];
+            encrypted[i] = ((encrypted[i] + 13) % 256);
+        }
+        return encrypted;
+    }
+    
+    static std::string decrypt(std::string_view ciphertext) {
+        std::string decrypted(ciphertext);
+        for (size_t i = 0; i < decrypted.length(); i++) {
+            decrypted[i] = ((decrypted[i] - 13 + 256) % 256);
+            decrypted[i] ^= Key::value[i % Key::length];
+        }
+        return decrypted;
+    }
+};
+
+template <typename Transport, typename Framing, typename Cipher>
+class MessagePipeline {
+public:
+    // Sends data that is already framed (multi-line replies, compressed frames)
+    static bool write(SOCKET_T sock, std::string_view data) {
+        return Transport::write(sock, data.data(), data.size());
+    }
+    
+    static bool writeLine(SOCKET_T sock, std::string_view payload) {
+        std::string framed;
+        framed.reserve(payload.size() + 1);
+        Framing::frame(framed, payload);
+        return write(sock, framed);
+    }
+    
+    // Multi-line replies are built as a run of frames and sent with one write
+    static void appendLine(std::string& batch, std::string_view payload) {
+        Framing::frame(batch, payload);
+    }
+    
+    static bool nextLine(std::string& pending, std::string& line) {
+        return Framing::next(pending, line);
+    }
+    
+    static int read(SOCKET_T sock, char* buffer, size_t length) {
+        return Transport::read(sock, buffer, length);
+    }
+    
+    // Blocks until a full frame is buffered; one read may carry several.
+    // Fails once more than MAX_LINE_LENGTH bytes arrive without a terminator.
+    static bool readLine(SOCKET_T sock, std::string& pending, std::string& line) {
+        char buffer[4096];
+        while (!Framing::next(pending, line)) {
+            if (pending.size() > MAX_LINE_LENGTH) {
+                return false;
+            }
+            int bytesReceived = read(sock, buffer, sizeof(buffer));
+            if (bytesReceived <= 0) {
+                return false;
+            }
+            pending.append(buffer, bytesReceived);
+        }
+        return true;
+    }
+    
+    static std::string encrypt(std::string_view plaintext) { return Cipher::encrypt(plaintext); }
+    static std::string decrypt(std::string_view ciphertext) { return Cipher::decrypt(ciphertext); }
+};
+
+using ChatPipeline = MessagePipeline<SocketTransport, LineFraming, StaticXorCipher<ChatKey>>;
+
+// Compressed frames are a "#Z <raw length> <compressed length>" header frame
+// followed by the compressed bytes; dictionary frames are a "#D <length>"
+// header frame followed by the dictionary. Returns an empty string when
+// compression would not pay off.
+std::string compressedFrame(const std::string& text, const LZCodec::Dictionary& dictionary) {
+    if (text.length() < COMPRESSION_THRESHOLD) return "";
+    std::string body = LZCodec::compress(text, dictionary);
+    std::string frame;
+    ChatPipeline::appendLine(frame, "#Z " + std::to_string(text.length()) + " " + std::to_string(body.length()));
+    if (frame.length() + body.length() >= text.length()) return "";
+    return frame + body;
+}
+
+std::string dictionaryFrame(const std::string& dictionary) {
+    std::string frame;
+    ChatPipeline::appendLine(frame, "#D " + std::to_string(dictionary.length()));
+    return frame + dictionary;
+}
+
+// Chat commands are looked up through a perfect hash over the whole name
+// (seeded FNV-1a plus length); the static_assert below fails the build if a
+// new command collides, in which case pick another COMMAND_HASH_SEED.
+enum class Command { Quit, Users, Encrypt, Join, Nick, Presence, History, Compress, Unknown };
+
+constexpr std::string_view COMMAND_NAMES[] = {
+    "/quit", "/users", "/encrypt", "/join", "/nick", "/presence", "/history", "/compress"
+};
+constexpr size_t COMMAND_COUNT = sizeof(COMMAND_NAMES) / sizeof(COMMAND_NAMES[0]);
+constexpr size_t COMMAND_SLOTS = 2 * COMMAND_COUNT;
+constexpr uint32_t COMMAND_HASH_SEED = 5;
+
+constexpr size_t commandHash(std::string_view name) {
+    uint32_t hash = 2166136261u ^ COMMAND_HASH_SEED;
+    for (char c : name) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 16777619u;
+    }
+    return (hash + name.size()) % COMMAND_SLOTS;
+}
+
+struct CommandTable {
+    Command slots[COMMAND_SLOTS];
+};
+
+constexpr CommandTable buildCommandTable() {
+    CommandTable table{};
+    for (size_t i = 0; i < COMMAND_SLOTS; i++) {
+        table.slots[i] = Command::Unknown;
+    }
+    for (size_t i = 0; i < COMMAND_COUNT; i++) {
+        table.slots[commandHash(COMMAND_NAMES[i])] = static_cast<Command>(i);
+    }
+    return table;
+}
+
+constexpr bool commandHashIsPerfect() {
+    for (size_t i = 0; i < COMMAND_COUNT; i++) {
+        for (size_t j = i + 1; j < COMMAND_COUNT; j++) {
+            if (commandHash(COMMAND_NAMES[i]) == commandHash(COMMAND_NAMES[j])) return false;
+        }
+    }
+    return true;
+}
+
+static_assert(COMMAND_COUNT == static_cast<size_t>(Command::Unknown), "COMMAND_NAMES must match Command");
+static_assert(commandHashIsPerfect(), "command hash collides; pick another COMMAND_HASH_SEED");
+
+constexpr CommandTable COMMAND_TABLE = buildCommandTable();
+
+inline Command lookupCommand(std::string_view name) {
+    Command id = COMMAND_TABLE.slots[commandHash(name)];
+    if (id != Command::Unknown && COMMAND_NAMES[static_cast<size_t>(id)] != name) {
+        return Command::Unknown;
+    }
+    return id;
+}
+
+// Splits the next whitespace-separated token off the front of rest
+inline std::string_view nextToken(std::string_view& rest) {
+    size_t start = rest.find_first_not_of(" \t");
+    if (start == std::string_view::npos) {
+        rest = std::string_view();
+        return rest;
+    }
+    size_t end = rest.find_first_of(" \t", start);
+    if (end == std::string_view::npos) end = rest.size();
+    std::string_view token = rest.substr(start, end - start);
+    rest.remove_prefix(end);
+    return token;
+}
+
+// "HH:MM:SS" for message prefixes, without going through a stream
+inline std::string formatTime(std::chrono::system_clock::time_point timestamp) {
+    auto time_t = std::chrono::system_clock::to_time_t(timestamp);
+    char buffer[16];
+    size_t length = std::strftime(buffer, sizeof(buffer), "%H:%M:%S", std::localtime(&time_t));
+    return std::string(buffer, length);
+}
+
+class ChatRoom;
+
 // User class
 class User {
 public:
@@ -136,9 +475,28 @@ public:
     std::pair<long long, long long> publicKey;
     SOCKET_T socket;
     bool connected;
+    bool presenceSubscribed;
+    bool compression;
+    ChatRoom* currentRoom;
     
     User(const std::string& name, SOCKET_T sock) 
-        : username(name), socket(sock), connected(true) {}
+        : username(name), socket(sock), connected(true),
+          presenceSubscribed(false), compression(false), currentRoom(nullptr) {}
+    
+    // Other users' threads write fan-out here too; the lock keeps a
+    // length-prefixed frame from being split by a concurrent reply
+    bool write(std::string_view data) {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        return ChatPipeline::write(socket, data);
+    }
+    
+    bool writeLine(std::string_view payload) {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        return ChatPipeline::writeLine(socket, payload);
+    }
+    
+private:
+    std::mutex sendMutex;
 };
 
 // Chat Room class
@@ -149,46 +507,161 @@ private:
     std::vector<Message> messageHistory;
     std::mutex roomMutex;
     
+    // Roster text is cached and only rebuilt when the version has moved on
+    unsigned long long rosterVersion;
+    unsigned long long rosterCacheVersion;
+    std::string rosterCache;
+    
+    // Shared by every compressing member so fan-out frames are built once
+    LZCodec::Dictionary dictionary;
+    
 public:
-    ChatRoom(const std::string& name) : roomName(name) {}
+    ChatRoom(const std::string& name)
+        : roomName(name), rosterVersion(0), rosterCacheVersion(0),
+          dictionary(LZCodec::prime(buildDictionary(name))) {
+        ChatPipeline::appendLine(rosterCache, "Users in " + name + " (v0):");
+    }
     
     void addUser(User* user) {
         std::lock_guard<std::mutex> lock(roomMutex);
+        if (user->compression) {
+            sendDictionary(user);
+        }
         users.push_back(user);
+        publishPresence("+" + user->username);
+        // A subscriber switching rooms gets the new roster in the same critical
+        // section, so no later delta can reach the socket ahead of it
+        if (user->presenceSubscribed) {
+            user->write(buildRoster());
+        }
         std::cout << "[" << roomName << "] " << user->username << " joined the room." << std::endl;
     }
     
-    void removeUser(User* user) {
+    bool removeUser(User* user) {
         std::lock_guard<std::mutex> lock(roomMutex);
-        users.erase(std::remove(users.begin(), users.end(), user), users.end());
+        auto it = std::find(users.begin(), users.end(), user);
+        if (it == users.end()) return false;
+        users.erase(it);
+        publishPresence("-" + user->username);
         std::cout << "[" << roomName << "] " << user->username << " left the room." << std::endl;
+        return true;
+    }
+    
+    void renameUser(User* user, const std::string& newName) {
+        std::lock_guard<std::mutex> lock(roomMutex);
+        std::string oldName = user->username;
+        user->username = newName;
+        publishPresence("~" + oldName + " " + newName);
+        std::cout << "[" << roomName << "] " << oldName << " is now " << newName << "." << std::endl;
+    }
+    
+    // Toggles presence events for a user and sends the roster they start from
+    // under the room lock, so no delta can reach the socket ahead of it
+    void subscribePresence(User* user, bool subscribe) {
+        std::lock_guard<std::mutex> lock(roomMutex);
+        user->presenceSubscribed = subscribe;
+        user->write(buildRoster());
+    }
+    
+    // The dictionary goes out under the room lock so it always precedes the
+    // first compressed frame the user receives
+    void setCompression(User* user, bool enable) {
+        std::lock_guard<std::mutex> lock(roomMutex);
+        if (enable && !user->compression) {
+            sendDictionary(user);
+        }
+        user->compression = enable;
     }
     
     void broadcastMessage(const Message& msg, User* sender) {
         std::lock_guard<std::mutex> lock(roomMutex);
         messageHistory.push_back(msg);
         
+        std::string formattedMsg;
+        appendMessage(formattedMsg, msg);
+        std::string compressedMsg;
+        bool compressedBuilt = false;
+        
         for (User* user : users) {
             if (user != sender && user->connected) {
-                std::string formattedMsg = formatMessage(msg);
-                send(user->socket, formattedMsg.c_str(), formattedMsg.length(), 0);
+                if (user->compression && !compressedBuilt) {
+                    compressedMsg = compressedFrame(formattedMsg, dictionary);
+                    compressedBuilt = true;
+                }
+                const std::string& out = (user->compression && !compressedMsg.empty())
+                                         ? compressedMsg : formattedMsg;
+                user->write(out);
             }
         }
     }
     
-    std::vector<User*> getUsers() {
+    void replayHistory(User* user, size_t count) {
         std::lock_guard<std::mutex> lock(roomMutex);
-        return users;
+        size_t first = messageHistory.size() - std::min(count, messageHistory.size());
+        
+        std::string replay;
+        ChatPipeline::appendLine(replay, "History of " + roomName + ":");
+        for (size_t i = first; i < messageHistory.size(); i++) {
+            appendMessage(replay, messageHistory[i]);
+        }
+        
+        std::string compressed = user->compression ? compressedFrame(replay, dictionary) : "";
+        const std::string& out = compressed.empty() ? replay : compressed;
+        user->write(out);
+    }
+    
+    std::string getRoster() {
+        std::lock_guard<std::mutex> lock(roomMutex);
+        return buildRoster();
     }
     
     std::string getRoomName() const { return roomName; }
     
 private:
-    std::string formatMessage(const Message& msg) {
-        auto time_t = std::chrono::system_clock::to_time_t(msg.timestamp);
-        std::stringstream ss;
-        ss << std::put_time(std::localtime(&time_t), "%H:%M:%S");
-        return "[" + ss.str() + "] " + msg.sender + ": " + msg.content + "\n";
+    static std::string buildDictionary(const std::string& name) {
+        // Seeded with the text that recurs in this room's traffic
+        return "Users in " + name + " joined the room. left the room. History of " + name + ":\n"
+               " [ENCRYPTED]: [ENCRYPTED MESSAGE]\n"
+               "the and that have for not with you this but his from they say her she will "
+               "one all would there their what out about who get which when make can like "
+               "time just him know take people into year your good some could them see other "
+               "than then now look only come its over think also back after use two how our "
+               "work first well way even new want because any these give day most us "
+               "hello thanks everyone please what's going on? I'm don't can't lol ok yes no ";
+    }
+    
+    // Caller must hold roomMutex
+    void sendDictionary(User* user) {
+        user->write(dictionaryFrame(dictionary.text));
+    }
+    
+    // Caller must hold roomMutex
+    const std::string& buildRoster() {
+        if (rosterCacheVersion != rosterVersion) {
+            rosterCache.clear();
+            ChatPipeline::appendLine(rosterCache, "Users in " + roomName + " (v" + std::to_string(rosterVersion) + "):");
+            for (const User* u : users) {
+                ChatPipeline::appendLine(rosterCache, "- " + u->username);
+            }
+            rosterCacheVersion = rosterVersion;
+        }
+        return rosterCache;
+    }
+    
+    // Caller must hold roomMutex. Bumps the roster version and pushes the
+    // change ("+name", "-name" or "~old new") to subscribed members.
+    void publishPresence(const std::string& change) {
+        ++rosterVersion;
+        std::string event = "[presence " + roomName + " v" + std::to_string(rosterVersion) + "] " + change;
+        for (User* u : users) {
+            if (u->presenceSubscribed && u->connected) {
+                u->writeLine(event);
+            }
+        }
+    }
+    
+    void appendMessage(std::string& out, const Message& msg) {
+        ChatPipeline::appendLine(out, "[" + formatTime(msg.timestamp) + "] " + msg.sender + ": " + msg.content);
     }
 };
 
@@ -198,6 +671,8 @@ private:
     SOCKET_T serverSocket;
     std::vector<ChatRoom*> chatRooms;
     std::map<SOCKET_T, User*> connectedUsers;
+    // Presence deltas identify users by name, so names are unique server-wide
+    std::map<std::string, User*> usernames;
     std::mutex serverMutex;
     bool running;
     
@@ -305,54 +780,56 @@ private:
     }
     
     void handleClient(SOCKET_T clientSocket) {
-        char buffer[1024];
+        std::string pending;
+        std::string username;
         
         // Receive username
-        int bytesReceived = recv(clientSocket, buffer, sizeof(buffer) - 1, 0);
-        if (bytesReceived <= 0) {
+        if (!ChatPipeline::readLine(clientSocket, pending, username)) {
             close_socket(clientSocket);
             return;
         }
         
-        buffer[bytesReceived] = '\0';
-        std::string username(buffer);
-        
         User* user = new User(username, clientSocket);
         
         {
             std::lock_guard<std::mutex> lock(serverMutex);
+            // Names are single tokens so "~old new" presence deltas stay unambiguous
+            if (username.empty() || username.find_first_of(" \t") != std::string::npos ||
+                !usernames.emplace(username, user).second) {
+                ChatPipeline::writeLine(clientSocket, "Username unavailable: " + username);
+                close_socket(clientSocket);
+                delete user;
+                return;
+            }
             connectedUsers[clientSocket] = user;
         }
         
         // Add user to General room by default
+        user->currentRoom = chatRooms[0];
         chatRooms[0]->addUser(user);
         
         // Send welcome message
-        std::string welcome = "Welcome to CipherChat, " + username + "!\n";
-        welcome += "Available commands:\n";
-        welcome += "/join <room> - Join a chat room\n";
-        welcome += "/users - List users in current room\n";
-        welcome += "/encrypt <message> - Send encrypted message\n";
-        welcome += "/quit - Leave the chat\n\n";
-        send(clientSocket, welcome.c_str(), welcome.length(), 0);
+        std::string welcome;
+        ChatPipeline::appendLine(welcome, "Welcome to CipherChat, " + username + "!");
+        ChatPipeline::appendLine(welcome, "Available commands:");
+        ChatPipeline::appendLine(welcome, "/join <room> - Join a chat room");
+        ChatPipeline::appendLine(welcome, "/users - List users in current room");
+        ChatPipeline::appendLine(welcome, "/nick <name> - Change your username");
+        ChatPipeline::appendLine(welcome, "/presence on|off - Receive join/leave/rename updates");
+        ChatPipeline::appendLine(welcome, "/history [count] - Replay recent messages");
+        ChatPipeline::appendLine(welcome, "/compress on|off - Compress large messages to this client");
+        ChatPipeline::appendLine(welcome, "/encrypt <message> - Send encrypted message");
+        ChatPipeline::appendLine(welcome, "/quit - Leave the chat");
+        ChatPipeline::appendLine(welcome, "");
+        user->write(welcome);
         
         // Handle client messages
+        std::string messageContent;
         while (running && user->connected) {
-            bytesReceived = recv(clientSocket, buffer, sizeof(buffer) - 1, 0);
-            if (bytesReceived <= 0) {
+            if (!ChatPipeline::readLine(clientSocket, pending, messageContent)) {
                 break;
             }
             
-            buffer[bytesReceived] = '\0';
-            std::string messageContent(buffer);
-            
-            if (messageContent.empty()) continue;
-            
-            // Remove newline if present
-            if (messageContent.back() == '\n') {
-                messageContent.pop_back();
-            }
-            
             processMessage(user, messageContent);
         }
         
@@ -367,6 +844,7 @@ private:
         {
             std::lock_guard<std::mutex> lock(serverMutex);
             connectedUsers.erase(clientSocket);
+            usernames.erase(user->username);
         }
         
         close_socket(clientSocket);
@@ -386,45 +864,97 @@ private:
             msg.timestamp = std::chrono::system_clock::now();
             msg.encrypted = false;
             
-            // Find user's current room (assume General for now)
-            chatRooms[0]->broadcastMessage(msg, user);
+            user->currentRoom->broadcastMessage(msg, user);
             
             // Echo back to sender
-            auto time_t = std::chrono::system_clock::to_time_t(msg.timestamp);
-            std::stringstream ss;
-            ss << std::put_time(std::localtime(&time_t), "%H:%M:%S");
-            std::string echo = "[" + ss.str() + "] You: " + messageContent + "\n";
-            send(user->socket, echo.c_str(), echo.length(), 0);
+            std::string echo = "[" + formatTime(msg.timestamp) + "] You: " + messageContent;
+            user->writeLine(echo);
         }
     }
     
     void handleCommand(User* user, const std::string& command) {
-        std::istringstream iss(command);
-        std::string cmd;
-        iss >> cmd;
+        std::string_view args(command);
+        std::string_view cmd = nextToken(args);
         
-        if (cmd == "/quit") {
+        switch (lookupCommand(cmd)) {
+        case Command::Quit: {
             user->connected = false;
-            std::string goodbye = "Goodbye, " + user->username + "!\n";
-            send(user->socket, goodbye.c_str(), goodbye.length(), 0);
+            user->writeLine("Goodbye, " + user->username + "!");
+            break;
+        }
+        case Command::Users: {
+            user->write(user->currentRoom->getRoster());
+            break;
+        }
+        case Command::Join: {
+            std::string roomName(nextToken(args));
+            
+            ChatRoom* target = findRoom(roomName);
+            if (!target) {
+                user->writeLine("No such room: " + roomName);
+            } else if (target == user->currentRoom) {
+                user->writeLine("Already in " + roomName);
+            } else {
+                user->currentRoom->removeUser(user);
+                user->currentRoom = target;
+                user->writeLine("Joined " + roomName);
+                // Sends the new roster to presence subscribers
+                target->addUser(user);
+            }
+            break;
+        }
+        case Command::Nick: {
+            std::string newName(nextToken(args));
+            
+            std::string reply;
+            if (newName.empty()) {
+                reply = "Usage: /nick <name>";
+            } else if (!claimUsername(user, newName)) {
+                reply = "Username already taken: " + newName;
+            } else {
+                user->currentRoom->renameUser(user, newName);
+                reply = "You are now " + newName;
+            }
+            user->writeLine(reply);
+            break;
+        }
+        case Command::History: {
+            std::string_view countArg = nextToken(args);
+            size_t count = 20;
+            std::from_chars(countArg.data(), countArg.data() + countArg.size(), count);
+            user->currentRoom->replayHistory(user, count);
+            break;
         }
-        else if (cmd == "/users") {
-            std::string userList = "Users in room:\n";
-            for (const auto& u : chatRooms[0]->getUsers()) {
-                userList += "- " + u->username + "\n";
+        case Command::Compress: {
+            std::string_view mode = nextToken(args);
+            
+            std::string reply;
+            if (mode == "on" || mode == "off") {
+                user->currentRoom->setCompression(user, mode == "on");
+                reply = "Compression " + std::string(mode);
+            } else {
+                reply = "Usage: /compress on|off";
+            }
+            user->writeLine(reply);
+            break;
+        }
+        case Command::Presence: {
+            std::string_view mode = nextToken(args);
+            
+            if (mode == "on" || mode == "off") {
+                user->currentRoom->subscribePresence(user, mode == "on");
+            } else {
+                user->writeLine("Usage: /presence on|off");
             }
-            send(user->socket, userList.c_str(), userList.length(), 0);
+            break;
         }
-        else if (cmd == "/encrypt") {
-            std::string encryptedMsg;
-            std::getline(iss, encryptedMsg);
-            if (!encryptedMsg.empty() && encryptedMsg[0] == ' ') {
-                encryptedMsg = encryptedMsg.substr(1);
+        case Command::Encrypt: {
+            if (!args.empty() && args[0] == ' ') {
+                args.remove_prefix(1);
             }
             
             // Simple encryption demonstration
-            SimpleCipher cipher("CipherChatKey123");
-            std::string encrypted = cipher.encrypt(encryptedMsg);
+            std::string encrypted = ChatPipeline::encrypt(args);
             
             Message msg;
             msg.sender = user->username + " [ENCRYPTED]";
@@ -432,16 +962,34 @@ private:
             msg.timestamp = std::chrono::system_clock::now();
             msg.encrypted = true;
             
-            chatRooms[0]->broadcastMessage(msg, user);
+            user->currentRoom->broadcastMessage(msg, user);
             
             // Send confirmation to sender
-            std::string confirm = "Encrypted message sent: " + encryptedMsg + "\n";
-            send(user->socket, confirm.c_str(), confirm.length(), 0);
+            user->writeLine("Encrypted message sent: " + std::string(args));
+            break;
         }
-        else {
-            std::string error = "Unknown command: " + cmd + "\n";
-            send(user->socket, error.c_str(), error.length(), 0);
+        case Command::Unknown: {
+            user->writeLine("Unknown command: " + std::string(cmd));
+            break;
         }
+        }
+    }
+    
+    ChatRoom* findRoom(const std::string& name) {
+        for (auto room : chatRooms) {
+            if (room->getRoomName() == name) return room;
+        }
+        return nullptr;
+    }
+    
+    // Checks and reserves the new name in one critical section and releases
+    // the old one. Only the user's own thread renames it, so reading its
+    // username here does not race.
+    bool claimUsername(User* user, const std::string& name) {
+        std::lock_guard<std::mutex> lock(serverMutex);
+        if (!usernames.emplace(name, user).second) return false;
+        usernames.erase(user->username);
+        return true;
     }
 };
 
@@ -450,10 +998,33 @@ class CipherChatClient {
 private:
     SOCKET_T clientSocket;
     std::string username;
-    bool connected;
+    std::atomic<bool> connected;
     std::thread receiveThread;
     SimpleRSA rsa;
     
+    // Library mode: inbound lines go to the handler instead of stdout
+    std::function<void(const std::string&)> messageHandler;
+    std::function<void()> disconnectHandler;
+    
+    // Compression negotiated with the server; frames are expanded on receipt
+    bool compression;
+    std::string dictionary;
+    
+    // Write batching: outgoing lines are coalesced and flushed by sendThread
+    // once the oldest pending line has waited batchLatency or the batch is full.
+    // Producers block while maxQueuedBytes are already waiting.
+    bool batching;
+    std::chrono::milliseconds batchLatency;
+    size_t maxBatchBytes;
+    size_t maxQueuedBytes;
+    std::string pendingBatch;
+    std::chrono::steady_clock::time_point batchStart;
+    bool stopSending;
+    std::mutex sendMutex;
+    std::condition_variable sendCondition;
+    std::condition_variable queueSpace;
+    std::thread sendThread;
+    
     void initializeWinsock() {
 #ifdef _WIN32
         WSADATA wsaData;
@@ -472,7 +1043,9 @@ private:
     }
     
 public:
-    CipherChatClient() : clientSocket(INVALID_SOCKET_VAL), connected(false) {
+    CipherChatClient()
+        : clientSocket(INVALID_SOCKET_VAL), connected(false), compression(false), batching(false),
+          batchLatency(0), maxBatchBytes(0), maxQueuedBytes(0), stopSending(false) {
         initializeWinsock();
         rsa.generateKeys();
     }
@@ -482,6 +1055,36 @@ public:
         cleanupWinsock();
     }
     
+    // Must be called before connectToServer
+    void setMessageHandler(std::function<void(const std::string&)> handler) {
+        messageHandler = std::move(handler);
+    }
+    
+    // Must be called before connectToServer. Runs once when the link drops, on
+    // whichever thread notices first: the receive thread, the batch sender, or
+    // the caller of connectToServer/sendMessage. Not run after a local
+    // disconnect(). The handler may call disconnect(); the client must
+    // outlive the call.
+    void setDisconnectHandler(std::function<void()> handler) {
+        disconnectHandler = std::move(handler);
+    }
+    
+    bool isConnected() const { return connected; }
+    
+    // Must be called before connectToServer
+    void enableCompression() {
+        compression = true;
+    }
+    
+    // Must be called before connectToServer
+    void enableBatching(std::chrono::milliseconds latencyBudget, size_t maxBytes = 64 * 1024,
+                        size_t maxQueued = 1024 * 1024) {
+        batching = true;
+        batchLatency = latencyBudget;
+        maxBatchBytes = maxBytes;
+        maxQueuedBytes = std::max(maxQueued, maxBytes);
+    }
+    
     bool connectToServer(const std::string& host, int port, const std::string& user) {
         username = user;
         
@@ -507,31 +1110,77 @@ public:
         }
         
         // Send username
-        send(clientSocket, username.c_str(), username.length(), 0);
-        
         connected = true;
+        if (!sendLine(username)) {
+            return false;
+        }
+        
+        if (compression && !sendLine("/compress on")) {
+            return false;
+        }
         
         // Start receiving messages
         receiveThread = std::thread(&CipherChatClient::receiveMessages, this);
         
+        if (batching) {
+            stopSending = false;
+            sendThread = std::thread(&CipherChatClient::sendBatches, this);
+        }
+        
         return true;
     }
     
     void disconnect() {
+        // Let the batcher drain whatever is still queued before the socket goes away
+        if (sendThread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(sendMutex);
+                stopSending = true;
+            }
+            sendCondition.notify_one();
+            queueSpace.notify_all();
+            joinOrDetach(sendThread);
+        }
+        
         connected = false;
         if (clientSocket != INVALID_SOCKET_VAL) {
+            shutdown(clientSocket, SHUTDOWN_BOTH_VAL);
             close_socket(clientSocket);
             clientSocket = INVALID_SOCKET_VAL;
         }
-        if (receiveThread.joinable()) {
-            receiveThread.join();
-        }
+        joinOrDetach(receiveThread);
     }
     
-    void sendMessage(const std::string& message) {
-        if (connected && !message.empty()) {
-            send(clientSocket, message.c_str(), message.length(), 0);
+    // Returns false if the message was not sent or queued. With batching on,
+    // blocks while the queue is full until the sender makes room or the link
+    // goes down.
+    bool sendMessage(const std::string& message) {
+        if (!connected || message.empty()) return false;
+        
+        if (!batching) {
+            return sendLine(message);
+        }
+        
+        bool wake;
+        {
+            std::unique_lock<std::mutex> lock(sendMutex);
+            queueSpace.wait(lock, [this] {
+                return pendingBatch.size() < maxQueuedBytes || stopSending || !connected;
+            });
+            if (stopSending || !connected) return false;
+            
+            bool startsBatch = pendingBatch.empty();
+            if (startsBatch) {
+                batchStart = std::chrono::steady_clock::now();
+            }
+            ChatPipeline::appendLine(pendingBatch, message);
+            // The batcher only needs waking to start a new deadline or to flush early
+            wake = startsBatch || pendingBatch.size() >= maxBatchBytes;
         }
+        if (wake) {
+            sendCondition.notify_one();
+        }
+        return true;
     }
     
     void startChat() {
@@ -552,18 +1201,155 @@ public:
     }
     
 private:
+    bool sendAll(const std::string& data) {
+        if (!ChatPipeline::write(clientSocket, data)) {
+            linkDropped();
+            return false;
+        }
+        return true;
+    }
+    
+    bool sendLine(std::string_view payload) {
+        std::string framed;
+        ChatPipeline::appendLine(framed, payload);
+        return sendAll(framed);
+    }
+    
+    // The disconnect handler may call disconnect() from one of the worker
+    // threads, which cannot join itself; that thread is detached and unwinds
+    static void joinOrDetach(std::thread& worker) {
+        if (!worker.joinable()) return;
+        if (worker.get_id() == std::this_thread::get_id()) {
+            worker.detach();
+        } else {
+            worker.join();
+        }
+    }
+    
+    // Reports a lost link once, whichever thread notices it first
+    void linkDropped() {
+        if (!connected.exchange(false)) return;
+        {
+            // Taking the lock orders the flag change before any producer's wait
+            std::lock_guard<std::mutex> lock(sendMutex);
+        }
+        queueSpace.notify_all();
+        if (disconnectHandler) {
+            disconnectHandler();
+        } else if (!messageHandler) {
+            std::cout << "\nDisconnected from server." << std::endl;
+        }
+    }
+    
+    void sendBatches() {
+        std::unique_lock<std::mutex> lock(sendMutex);
+        while (true) {
+            sendCondition.wait(lock, [this] { return stopSending || !pendingBatch.empty(); });
+            if (pendingBatch.empty()) break;
+            
+            sendCondition.wait_until(lock, batchStart + batchLatency, [this] {
+                return stopSending || pendingBatch.size() >= maxBatchBytes;
+            });
+            
+            std::string batch;
+            batch.swap(pendingBatch);
+            queueSpace.notify_all();
+            lock.unlock();
+            bool ok = sendAll(batch);
+            lock.lock();
+            
+            if (!ok) {
+                pendingBatch.clear();
+                break;
+            }
+        }
+    }
+    
+    void deliver(const std::string& line) {
+        if (messageHandler) {
+            messageHandler(line);
+        } else {
+            std::cout << line << '\n';
+        }
+    }
+    
+    // Parses a "#Z"/"#D" header; returns false for ordinary text lines
+    bool parseFrameHeader(const std::string& line, char& kind, size_t& rawLength, size_t& frameLength) {
+        if (line.size() < 4 || line[0] != '#' || (line[1] != 'Z' && line[1] != 'D') || line[2] != ' ') {
+            return false;
+        }
+        std::string_view args(line);
+        args.remove_prefix(3);
+        kind = line[1];
+        rawLength = 0;
+        if (kind == 'Z' && !parseLength(nextToken(args), rawLength)) {
+            return false;
+        }
+        return parseLength(nextToken(args), frameLength);
+    }
+    
+    static bool parseLength(std::string_view token, size_t& value) {
+        auto result = std::from_chars(token.data(), token.data() + token.size(), value);
+        return !token.empty() && result.ec == std::errc() && result.ptr == token.data() + token.size();
+    }
+    
+    void handleFrame(char kind, const std::string& body, size_t rawLength) {
+        if (kind == 'D') {
+            dictionary = body;
+            return;
+        }
+        
+        std::string text;
+        if (!LZCodec::decompress(body, dictionary, rawLength, text)) {
+            deliver("[Corrupt compressed frame dropped]");
+            return;
+        }
+        std::string line;
+        while (ChatPipeline::nextLine(text, line)) {
+            deliver(line);
+        }
+        if (!text.empty()) {
+            deliver(text);
+        }
+    }
+    
     void receiveMessages() {
-        char buffer[1024];
+        char buffer[16384];
+        std::string pending;
+        std::string line;
+        char frameKind = 0;
+        size_t rawLength = 0;
+        size_t frameLength = 0;
         while (connected) {
-            int bytesReceived = recv(clientSocket, buffer, sizeof(buffer) - 1, 0);
+            int bytesReceived = ChatPipeline::read(clientSocket, buffer, sizeof(buffer));
             if (bytesReceived <= 0) {
-                connected = false;
-                std::cout << "\nDisconnected from server." << std::endl;
+                linkDropped();
                 break;
             }
             
-            buffer[bytesReceived] = '\0';
-            std::cout << buffer << std::flush;
+            pending.append(buffer, bytesReceived);
+            while (true) {
+                if (frameKind) {
+                    if (pending.size() < frameLength) break;
+                    handleFrame(frameKind, pending.substr(0, frameLength), rawLength);
+                    pending.erase(0, frameLength);
+                    frameKind = 0;
+                } else if (ChatPipeline::nextLine(pending, line)) {
+                    if (!parseFrameHeader(line, frameKind, rawLength, frameLength)) {
+                        frameKind = 0;
+                        deliver(line);
+                    } else if (frameLength > LZCodec::MAX_RAW_LENGTH || rawLength > LZCodec::MAX_RAW_LENGTH) {
+                        // Refuse to buffer an oversized body; the stream cannot resync past it
+                        linkDropped();
+                        return;
+                    }
+                } else {
+                    break;
+                }
+            }
+            if (!messageHandler) {
+                std::cout << std::flush;
+            }
         }
     }
 };